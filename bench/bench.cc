@@ -0,0 +1,496 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <math.h>
+#include <exception>
+#include <stdexcept>
+
+#include "katana.h"
+#include "meshgen.h"
+#include "perfcheck.h"
+
+// microbenchmarks of the slicing stages on generated meshes
+// every stage is timed on its own, on input prepared by the stages before it, for a range of
+// mesh sizes. the throughput over size shows how a stage scales, the segment building is
+// additionally run with growing thread counts.
+
+// a stage is repeated until it ran this long, and the fastest run is reported
+static const double minSeconds=0.2;
+static const int maxRuns=10;
+
+// the mesh sizes benchmarked, limited by --max-triangles
+static const long sizes[]={1000,10000,100000,1000000,10000000};
+
+// one measurement
+struct BenchResult
+{
+  std::string benchmark;
+  std::string shape;
+  long triangles;    // of the mesh
+  long items;        // processed in one run, e.g. triangles or segments
+  const char* unit;
+  double seconds;    // of the fastest run
+};
+
+// run body repeatedly, calling setup before every run. returns the seconds of the fastest run.
+static double measure(std::function<void()> setup, std::function<void()> body)
+{
+  double best=1e30, total=0;
+  for(int run=0; run<maxRuns && total<minSeconds; run++){
+    setup();
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    body();
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    best=std::min(best,seconds);
+    total+=seconds;
+  }
+  return best;
+}
+
+static void report(std::vector<BenchResult>& results, const char* benchmark, const std::string& shape, long triangles, long items, const char* unit, double seconds)
+{
+  BenchResult result={benchmark,shape,triangles,items,unit,seconds};
+  results.push_back(result);
+  printf("%-24s %-11s %9ld  %10ld %-9s %10.3f ms  %8.3f M%s/s\n",benchmark,shape.c_str(),triangles,
+      items,unit,seconds*1e3,seconds>0 ? items/seconds*1e-6 : 0.0,unit);
+}
+
+// benchmark all stages on one mesh
+static void benchMesh(SliceJob& job, const std::string& filename, const std::string& shape, std::vector<BenchResult>& results)
+{
+  struct stat info;
+  stat(filename.c_str(),&info);
+
+  // loading
+  double seconds=measure([&](){
+    job.vertices.clear();
+    job.triangles.clear();
+    job.objects.clear();
+  },[&](){
+    job.stl.loadStl(job,filename.c_str());
+  });
+  long triangles=job.triangles.size();
+  report(results,"loadStl",shape,triangles,triangles,"tri",seconds);
+  report(results,"loadStl-bytes",shape,triangles,info.st_size,"B",seconds);
+
+  // loading the gzip compressed file, decompressed on a second thread while parsing
+  std::string compressed=MeshGenerator::cachedGzip(filename);
+  seconds=measure([&](){
+    job.vertices.clear();
+    job.triangles.clear();
+    job.objects.clear();
+  },[&](){
+    job.stl.loadStl(job,compressed.c_str());
+  });
+  report(results,"loadStl-gzip",shape,triangles,triangles,"tri",seconds);
+
+  // layers
+  seconds=measure([&](){
+    job.layers.clear();
+  },[&](){
+    job.slicer.buildLayers(job);
+  });
+  long layerTriangles=0;
+  for(unsigned int i=0; i<job.layers.size(); i++)
+    layerTriangles+=job.layers[i].triangles.size();
+  report(results,"buildLayers",shape,triangles,triangles,"tri",seconds);
+
+  // intersecting the triangles of all layers
+  std::vector<Segment> sink;
+  sink.reserve(layerTriangles);
+  seconds=measure([&](){
+    sink.clear();
+  },[&](){
+    for(unsigned int i=0; i<job.layers.size(); i++){
+      Layer& layer=job.layers[i];
+      for(unsigned int j=0; j<layer.triangles.size(); j++)
+        sink.push_back(job.slicer.computeSegment(*layer.triangles[j],layer.z));
+    }
+  });
+  report(results,"computeSegment",shape,triangles,layerTriangles,"seg",seconds);
+
+  // the raw contours of every layer, as input of the contour stages
+  std::vector<std::vector<Segment> > contours(job.layers.size());
+  long segments=0;
+  for(unsigned int i=0; i<job.layers.size(); i++){
+    Layer& layer=job.layers[i];
+    for(unsigned int j=0; j<layer.triangles.size(); j++){
+      Segment s=job.slicer.computeSegment(*layer.triangles[j],layer.z);
+      if(s.vertices[0]!=s.vertices[1])
+        contours[i].push_back(s);
+    }
+    segments+=contours[i].size();
+  }
+
+  std::vector<std::vector<Segment> > work;
+  seconds=measure([&](){
+    work=contours;
+  },[&](){
+    std::map<Vertex,std::vector<Segment*>> segmentsByVertex;
+    for(unsigned int i=0; i<work.size(); i++){
+      segmentsByVertex.clear();
+      job.slicer.unifySegmentVertices(work[i],segmentsByVertex);
+    }
+  });
+  report(results,"unifySegmentVertices",shape,triangles,segments,"seg",seconds);
+
+  float offset=-job.settings.nozzle_diameter/2;
+  seconds=measure([&](){
+    work=contours;
+  },[&](){
+    for(unsigned int i=0; i<work.size(); i++)
+      job.slicer.offsetSegments(work[i],offset);
+  });
+  report(results,"offsetSegments",shape,triangles,segments,"seg",seconds);
+
+  // the complete contour stage on the pool, as used when slicing
+  std::vector<Layer> layers=job.layers;
+  seconds=measure([&](){
+    job.layers=layers;
+  },[&](){
+    job.slicer.buildSegments(job);
+  });
+  report(results,"buildSegments",shape,triangles,segments,"seg",seconds);
+
+  // nesting the loops, which lets the hatching fill every island on its own
+  seconds=measure([](){},[&](){
+    for(unsigned int i=0; i<job.layers.size(); i++)
+      job.slicer.nestLoops(job,job.layers[i]);
+  });
+  long contourSegments=0;
+  for(unsigned int i=0; i<job.layers.size(); i++)
+    contourSegments+=job.layers[i].segments.size();
+  report(results,"nestLoops",shape,triangles,contourSegments,"seg",seconds);
+
+  // rasters of the nested loops at a quarter of the nozzle, and the overhang booleans
+  job.settings.raster_resolution=job.settings.nozzle_diameter/4;
+  seconds=measure([](){},[&](){
+    job.rasterizer.rasterize(job);
+  });
+  job.settings.raster_resolution=0;
+  for(unsigned int i=0; i<job.layers.size(); i++)
+    job.layers[i].raster.reset();
+  report(results,"Rasterizer::rasterize",shape,triangles,job.layers.size(),"layer",seconds);
+
+  // hatching the finished contours. it appends the infill, so it works on a copy.
+  std::vector<Layer> contoured=job.layers;
+  seconds=measure([&](){
+    job.layers=contoured;
+  },[&](){
+    for(unsigned int i=0; i<job.layers.size(); i++)
+      if(!job.layers[i].segments.empty())
+        job.infill.hatch(job,i,job.layers[i]);
+  });
+  long hatched=0;
+  for(unsigned int i=0; i<job.layers.size(); i++)
+    hatched+=job.layers[i].segments.size()-contoured[i].segments.size();
+  report(results,"Infill::hatch",shape,triangles,hatched,"seg",seconds);
+
+  // every hatch line has to run through material, not across a hole or outside the part.
+  // layers with open chains are filled as a whole and have no nesting to check against.
+  for(unsigned int i=0; i<job.layers.size(); i++){
+    const Layer& layer=job.layers[i];
+    unsigned int looped=0;
+    for(unsigned int j=0; j<layer.loops.size(); j++)
+      looped+=layer.loops[j].count;
+    if(layer.loops.empty() || looped!=contoured[i].segments.size()) continue;
+    for(unsigned int j=looped; j<layer.segments.size(); j++){
+      const Segment& s=layer.segments[j];
+      Vertex middle=(s.vertices[0]+s.vertices[1])*0.5f;
+      if(middle.z==layer.z && !job.slicer.inside(layer,middle))
+        throw std::runtime_error("Hatching of "+filename+" leaves the material in layer "+std::to_string(i));
+    }
+  }
+
+  // gcode of the contours, encoded but not stored
+  job.layers=contoured;
+  job.arcs.fitArcs(job);
+  std::vector<Layer> sliced=job.layers;
+  long emitted=0;
+  for(unsigned int i=0; i<job.layers.size(); i++)
+    emitted+=job.layers[i].segments.size();
+  long bytes=0;
+  seconds=measure([&](){
+    bytes=0;
+  },[&](){
+    GCodeOutput output;
+    output.open([&](const char* data, size_t length){ bytes+=length; },job.settings.gcode_compression,job.settings.gzip_level);
+    job.gcode.write(job,output);
+  });
+  report(results,"GCodeWriter::write",shape,triangles,emitted,"seg",seconds);
+  report(results,"GCodeWriter::write-bytes",shape,triangles,bytes,"B",seconds);
+
+  // binary contours with their hatching, streamed but not stored. arc fitting moved the loops.
+  job.slicer.buildLoops(job);
+  seconds=measure([&](){
+    bytes=0;
+  },[&](){
+    GCodeOutput output;
+    output.open([&](const char* data, size_t length){ bytes+=length; },GCodeOutput::NONE,0);
+    job.contours.write(job,output,ContourWriter::KLC);
+  });
+  report(results,"ContourWriter::write",shape,triangles,job.layers.size(),"layer",seconds);
+
+  // resin masks at the default 4K grid, run length encoded, streamed but not stored
+  seconds=measure([&](){
+    bytes=0;
+  },[&](){
+    GCodeOutput output;
+    output.open([&](const char* data, size_t length){ bytes+=length; },GCodeOutput::NONE,0);
+    job.masks.write(job,output);
+  });
+  report(results,"MaskWriter::write",shape,triangles,job.layers.size(),"layer",seconds);
+
+  // lazy slicing of the first and a few sampled layers on a fresh job, index included
+  static const int samples=8;
+  std::unique_ptr<SliceJob> lazy;
+  seconds=measure([&](){
+    lazy.reset(new SliceJob());
+    lazy->verbose=false;
+    lazy->settings=job.settings;
+    lazy->copyMesh(job);
+  },[&](){
+    int count=lazy->layerCount();
+    for(int i=0; i<=samples && count>0; i++)
+      lazy->layer(i*(count-1)/samples);
+  });
+  if(lazy->layerCount()!=(int)job.layers.size())
+    throw std::runtime_error("Lazy slicing of "+filename+" gives a different layer count");
+  for(int i=0; i<=samples && !job.layers.empty(); i++){
+    int index=i*(lazy->layerCount()-1)/samples;
+    const std::vector<Segment>& a=lazy->layer(index).segments;
+    const std::vector<Segment>& b=sliced[index].segments;
+    bool equal=a.size()==b.size();
+    for(unsigned int j=0; equal && j<a.size(); j++)
+      equal=a[j].vertices[0]==b[j].vertices[0] && a[j].vertices[1]==b[j].vertices[1] && a[j].arc==b[j].arc;
+    if(!equal)
+      throw std::runtime_error("Lazy slicing of "+filename+" differs in layer "+std::to_string(index));
+  }
+  report(results,"SliceJob::layer",shape,triangles,std::min((int)job.layers.size(),samples+1),"layer",seconds);
+
+  // quantized vertex storage: the memory of the mesh, and the same lazy slicing decoding the
+  // triangles of every layer, quantizing included
+  long meshBytes=job.vertices.size()*sizeof(Vertex)+job.triangles.size()*sizeof(Triangle);
+  report(results,"mesh-bytes",shape,triangles,meshBytes,"B",0);
+  for(int bits=16; bits<=21; bits+=5){
+    std::string suffix=std::to_string(bits);
+    QuantizedMesh quantized;
+    quantized.encode(job.vertices,job.triangles,bits);
+    report(results,("mesh-bytes-q"+suffix).c_str(),shape,triangles,quantized.bytes(),"B",0);
+
+    seconds=measure([&](){
+      lazy.reset(new SliceJob());
+      lazy->verbose=false;
+      lazy->settings=job.settings;
+      lazy->settings.vertex_bits=bits;
+      lazy->copyMesh(job);
+    },[&](){
+      int count=lazy->layerCount();
+      for(int i=0; i<=samples && count>0; i++)
+        lazy->layer(i*(count-1)/samples);
+    });
+    report(results,("SliceJob::layer-q"+suffix).c_str(),shape,triangles,std::min((int)job.layers.size(),samples+1),"layer",seconds);
+  }
+}
+
+// run the contour stage of one mesh with 1, 2, 4, ... threads on pools of their own
+static void benchThreads(SliceJob& job, const std::string& shape, std::vector<BenchResult>& results)
+{
+  int cores=std::max(1u,std::thread::hardware_concurrency());
+  std::vector<int> counts;
+  for(int threads=1; threads<cores; threads*=2)
+    counts.push_back(threads);
+  counts.push_back(cores);
+
+  job.layers.clear();
+  job.slicer.buildLayers(job);
+  std::vector<Layer> layers=job.layers;
+  long triangles=job.triangles.size();
+  float nozzle_diameter=job.settings.nozzle_diameter, resolution=job.settings.resolution;
+
+  double single=0;
+  for(unsigned int i=0; i<counts.size(); i++){
+    ThreadPool pool;
+    pool.start(counts[i]);
+    double seconds=measure([&](){
+      job.layers=layers;
+    },[&](){
+      pool.parallelFor(0,job.layers.size(),[&](int layerIndex){
+        job.slicer.buildLayerSegments(job,layerIndex,nozzle_diameter,resolution);
+      });
+    });
+    if(i==0) single=seconds;
+
+    std::string name="buildSegments-threads-"+std::to_string(counts[i]);
+    BenchResult result={name,shape,triangles,counts[i],"thread",seconds};
+    results.push_back(result);
+    printf("%-24s %-11s %9ld  %10d threads   %10.3f ms  %8.2fx\n",name.c_str(),shape.c_str(),triangles,
+        counts[i],seconds*1e3,single/seconds);
+  }
+}
+
+// print how the time grows with the mesh size: the exponent k of time ~ triangles^k.
+// 1 is linear, above 1 the stage gets slower per triangle for larger meshes. stages working on
+// the contours only grow with the square root of the triangles for finer tessellations.
+static void printScaling(const std::vector<BenchResult>& results)
+{
+  printf("\nScaling exponents (time ~ triangles^k) between consecutive sizes:\n");
+  std::map<std::string,std::vector<const BenchResult*> > series;
+  std::vector<std::string> order;
+  for(unsigned int i=0; i<results.size(); i++){
+    std::string key=results[i].benchmark+" "+results[i].shape;
+    if(results[i].unit==std::string("thread") || results[i].unit==std::string("B")) continue;
+    if(series.count(key)==0) order.push_back(key);
+    series[key].push_back(&results[i]);
+  }
+  for(unsigned int i=0; i<order.size(); i++){
+    std::vector<const BenchResult*>& s=series[order[i]];
+    if(s.size()<2) continue;
+    printf("%-34s",order[i].c_str());
+    for(unsigned int j=1; j<s.size(); j++){
+      double k=log(std::max(s[j]->seconds,1e-9)/std::max(s[j-1]->seconds,1e-9))/log((double)s[j]->triangles/s[j-1]->triangles);
+      printf("  %5.2f",k);
+    }
+    printf("\n");
+  }
+}
+
+static void writeJson(FILE* file, const std::vector<BenchResult>& results)
+{
+  fprintf(file,"{\n  \"results\": [");
+  for(unsigned int i=0; i<results.size(); i++){
+    const BenchResult& r=results[i];
+    fprintf(file,"%s\n    {\"benchmark\": \"%s\", \"shape\": \"%s\", \"triangles\": %ld, \"items\": %ld, \"unit\": \"%s\", \"seconds\": %.6f}",
+        i ? "," : "",r.benchmark.c_str(),r.shape.c_str(),r.triangles,r.items,r.unit,r.seconds);
+  }
+  fprintf(file,"\n  ]\n}\n");
+}
+
+static int usage(const char* name)
+{
+  printf("Usage: %s [options]\n",name);
+  printf("       %s --generate <shape> <triangles> <.stl file>\n",name);
+  printf("       %s --perfcheck <baseline file> [--update] [--katana <binary>] [--warn-time]\n",name);
+  printf("Options:\n");
+  printf("  --config <file>        read the config from file instead of config.ini\n");
+  printf("  --set <name=value>     override a config value, may be repeated\n");
+  printf("  --shapes <a,b,..>      shapes to benchmark, default sphere,torus,lattice,sphere-nm\n");
+  printf("  --max-triangles <n>    largest mesh size, sizes are 1K, 10K, ... up to 10M. default 100000\n");
+  printf("  --meshes <directory>   where generated meshes are kept, default build/bench\n");
+  printf("  --json <file>          write the results as JSON\n");
+  printf("Shapes:");
+  for(int i=0; MeshGenerator::shapes[i]; i++)
+    printf(" %s",MeshGenerator::shapes[i]);
+  printf("\n");
+  return 1;
+}
+
+int main(int argc, const char** argv)
+{
+  const char* configFile="config.ini";
+  std::vector<std::string> overrides;
+  std::string shapeList="sphere,torus,lattice,sphere-nm";
+  long maxTriangles=100000;
+  std::string directory="build/bench";
+  const char* json=NULL;
+  const char* baseline=NULL;
+  bool update=false;
+  PerfCheck perfcheck;
+
+  for(int i=1; i<argc; i++) {
+    if     (strcmp(argv[i],"--config")==0 && i+1<argc)        configFile=argv[++i];
+    else if(strcmp(argv[i],"--set")==0    && i+1<argc)        overrides.push_back(argv[++i]);
+    else if(strcmp(argv[i],"--shapes")==0 && i+1<argc)        shapeList=argv[++i];
+    else if(strcmp(argv[i],"--max-triangles")==0 && i+1<argc) maxTriangles=atol(argv[++i]);
+    else if(strcmp(argv[i],"--meshes")==0 && i+1<argc)        directory=argv[++i];
+    else if(strcmp(argv[i],"--json")==0   && i+1<argc)        json=argv[++i];
+    else if(strcmp(argv[i],"--perfcheck")==0 && i+1<argc)     baseline=argv[++i];
+    else if(strcmp(argv[i],"--update")==0)                    update=true;
+    else if(strcmp(argv[i],"--katana")==0 && i+1<argc)        perfcheck.katana=argv[++i];
+    else if(strcmp(argv[i],"--warn-time")==0)                 perfcheck.warnOnTime=true;
+    else if(strcmp(argv[i],"--generate")==0 && i+3<argc) {
+      std::vector<MeshGenerator::Face> faces;
+      if(!MeshGenerator::generate(argv[i+1],atol(argv[i+2]),faces))
+        return usage(argv[0]);
+      if(!MeshGenerator::writeStl(argv[i+3],faces)) {
+        printf("Error: can't write %s\n",argv[i+3]);
+        return 1;
+      }
+      printf("%s: %u triangles\n",argv[i+3],(unsigned int)faces.size());
+      return 0;
+    }
+    else return usage(argv[0]);
+  }
+
+  std::vector<std::string> shapes;
+  for(size_t begin=0; begin<shapeList.size(); ){
+    size_t end=shapeList.find(',',begin);
+    if(end==std::string::npos) end=shapeList.size();
+    shapes.push_back(shapeList.substr(begin,end-begin));
+    begin=end+1;
+  }
+
+  try {
+    // end to end check of the katana binary against the baseline
+    if(baseline) {
+      perfcheck.config=configFile;
+      perfcheck.directory=directory;
+      return perfcheck.run(baseline,update) ? 2 : 0;
+    }
+
+    // the config is read once and copied into the jobs
+    SliceJob configured;
+    configured.configure(configFile,NULL,overrides);
+    Katana::Instance().pool.start(configured.settings.threads);
+
+    std::vector<BenchResult> results;
+    printf("%-24s %-11s %9s  %20s %13s  %12s\n","benchmark","shape","triangles","items","time","throughput");
+    for(unsigned int s=0; s<shapes.size(); s++)
+      for(unsigned int i=0; i<sizeof(sizes)/sizeof(sizes[0]) && sizes[i]<=maxTriangles; i++){
+        std::string filename=MeshGenerator::cachedStl(directory,shapes[s],sizes[i]);
+        SliceJob job;
+        job.verbose=false;
+        job.settings=configured.settings;
+        benchMesh(job,filename,shapes[s],results);
+      }
+
+    // thread scaling on the largest mesh of the first shape
+    if(!shapes.empty()){
+      long size=sizes[0];
+      for(unsigned int i=0; i<sizeof(sizes)/sizeof(sizes[0]) && sizes[i]<=maxTriangles; i++)
+        size=sizes[i];
+      SliceJob job;
+      job.verbose=false;
+      job.settings=configured.settings;
+      job.load(MeshGenerator::cachedStl(directory,shapes[0],size).c_str());
+      printf("\n");
+      benchThreads(job,shapes[0],results);
+    }
+
+    printScaling(results);
+
+    if(json) {
+      FILE* file=fopen(json,"w");
+      if(!file)
+        throw std::runtime_error(std::string("Can't write ")+json);
+      writeJson(file,results);
+      fclose(file);
+    }
+  } catch(std::exception& e) {
+    printf("Error: %s\n",e.what());
+    return 1;
+  }
+
+  return 0;
+}
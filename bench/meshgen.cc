@@ -0,0 +1,225 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <math.h>
+#include <exception>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "datastructures.h"
+#include "meshgen.h"
+
+const char* MeshGenerator::shapes[]={"sphere","torus","lattice","sphere-nm","torus-nm","lattice-nm",NULL};
+
+// generate about the given number of triangles of a shape
+bool MeshGenerator::generate(const std::string& shape, long triangles, std::vector<Face>& faces)
+{
+  faces.clear();
+  bool nonManifold=shape.size()>3 && shape.compare(shape.size()-3,3,"-nm")==0;
+  std::string base=nonManifold ? shape.substr(0,shape.size()-3) : shape;
+
+  // sizes in mm, so the layer count grows with the tessellation like for real parts
+  if     (base=="sphere")  sphere(triangles,25,faces);
+  else if(base=="torus")   torus(triangles,30,10,faces);
+  else if(base=="lattice") lattice(triangles,faces);
+  else return false;
+
+  if(nonManifold)
+    breakManifold(faces);
+  return true;
+}
+
+// write the faces as an ASCII .stl file
+bool MeshGenerator::writeStl(const char* filename, const std::vector<Face>& faces)
+{
+  FILE* file=fopen(filename,"w");
+  if(!file) return false;
+
+  fprintf(file,"solid generated\n");
+  for(unsigned int i=0; i<faces.size(); i++){
+    const Face& f=faces[i];
+    Vertex ab=f[1]-f[0], ac=f[2]-f[0];
+    Vertex n={ab.y*ac.z-ab.z*ac.y,ab.z*ac.x-ab.x*ac.z,ab.x*ac.y-ab.y*ac.x};
+    n=n.normalize();
+    fprintf(file," facet normal %e %e %e\n  outer loop\n",n.x,n.y,n.z);
+    for(int j=0; j<3; j++)
+      fprintf(file,"   vertex %e %e %e\n",f[j].x,f[j].y,f[j].z);
+    fprintf(file,"  endloop\n endfacet\n");
+  }
+  fprintf(file,"endsolid generated\n");
+
+  bool ok=!ferror(file);
+  return fclose(file)==0 && ok;
+}
+
+// the .stl file of a shape and size in directory, generated if it doesn't exist yet
+std::string MeshGenerator::cachedStl(const std::string& directory, const std::string& shape, long triangles)
+{
+  std::string filename=directory+"/"+shape+"-"+std::to_string(triangles)+".stl";
+  struct stat info;
+  if(stat(filename.c_str(),&info)==0)
+    return filename;
+
+  std::vector<Face> faces;
+  if(!generate(shape,triangles,faces))
+    throw std::runtime_error("Unknown shape "+shape);
+  printf("Generating %s with %u triangles\n",filename.c_str(),(unsigned int)faces.size());
+  mkdir(directory.c_str(),0755);
+  if(!writeStl(filename.c_str(),faces))
+    throw std::runtime_error("Can't write "+filename);
+  return filename;
+}
+
+// a gzip compressed copy of a file, made if it doesn't exist yet
+std::string MeshGenerator::cachedGzip(const std::string& filename)
+{
+  std::string compressed=filename+".gz";
+  struct stat info;
+  if(stat(compressed.c_str(),&info)==0)
+    return compressed;
+
+  FILE* in=fopen(filename.c_str(),"rb");
+  gzFile out=gzopen(compressed.c_str(),"wb6");
+  if(!in || !out){
+    if(in) fclose(in);
+    if(out) gzclose(out);
+    throw std::runtime_error("Can't write "+compressed);
+  }
+  char buffer[65536];
+  size_t n;
+  bool ok=true;
+  while(ok && (n=fread(buffer,1,sizeof(buffer),in))>0)
+    ok=gzwrite(out,buffer,n)==(int)n;
+  fclose(in);
+  if(gzclose(out)!=Z_OK || !ok){
+    remove(compressed.c_str());
+    throw std::runtime_error("Can't write "+compressed);
+  }
+  return compressed;
+}
+
+// UV sphere of radius r.
+// s stacks and 2s slices give 4s(s-1) triangles, the poles are fans.
+void MeshGenerator::sphere(long triangles, float r, std::vector<Face>& faces)
+{
+  int stacks=std::max(2,(int)(sqrt(triangles/4.0)+0.5));
+  int slices=2*stacks;
+
+  // the poles are set explicitly, so all their triangles share exactly one vertex
+  std::vector<Vertex> grid((stacks+1)*slices);
+  for(int i=0; i<=stacks; i++)
+    for(int j=0; j<slices; j++){
+      double theta=M_PI*i/stacks, phi=2*M_PI*j/slices;
+      Vertex p={(float)(r*sin(theta)*cos(phi)),(float)(r*sin(theta)*sin(phi)),(float)(r*cos(theta))};
+      if(i==0)      p=(Vertex){0,0,r};
+      if(i==stacks) p=(Vertex){0,0,-r};
+      grid[i*slices+j]=p;
+    }
+
+  faces.reserve(4L*stacks*(stacks-1));
+  for(int i=0; i<stacks; i++)
+    for(int j=0; j<slices; j++){
+      int k=(j+1)%slices;
+      const Vertex& a=grid[i*slices+j];
+      const Vertex& b=grid[(i+1)*slices+j];
+      const Vertex& c=grid[(i+1)*slices+k];
+      const Vertex& d=grid[i*slices+k];
+      if(i<stacks-1) add(faces,a,b,c,a+b+c);
+      if(i>0)        add(faces,a,c,d,a+c+d);
+    }
+}
+
+// torus of major radius R and minor radius r.
+// u segments around the axis and v=u/2 around the tube give 2uv triangles.
+void MeshGenerator::torus(long triangles, float R, float r, std::vector<Face>& faces)
+{
+  int v=std::max(3,(int)(sqrt(triangles/4.0)+0.5));
+  int u=2*v;
+
+  std::vector<Vertex> grid(u*v), centers(u);
+  for(int i=0; i<u; i++){
+    double phi=2*M_PI*i/u;
+    centers[i]=(Vertex){(float)(R*cos(phi)),(float)(R*sin(phi)),0};
+    for(int j=0; j<v; j++){
+      double theta=2*M_PI*j/v;
+      grid[i*v+j]=(Vertex){(float)((R+r*cos(theta))*cos(phi)),(float)((R+r*cos(theta))*sin(phi)),(float)(r*sin(theta))};
+    }
+  }
+
+  faces.reserve(2L*u*v);
+  for(int i=0; i<u; i++)
+    for(int j=0; j<v; j++){
+      int i1=(i+1)%u, j1=(j+1)%v;
+      const Vertex& a=grid[i*v+j];
+      const Vertex& b=grid[i1*v+j];
+      const Vertex& c=grid[i1*v+j1];
+      const Vertex& d=grid[i*v+j1];
+      add(faces,a,b,c,a-centers[i]);
+      add(faces,a,c,d,a-centers[i]);
+    }
+}
+
+// grid of k^3 separate cubes with 12 triangles each.
+// the heights are chosen so no horizontal face lies on a layer plane.
+void MeshGenerator::lattice(long triangles, std::vector<Face>& faces)
+{
+  int k=std::max(1,(int)(cbrt(triangles/12.0)+0.5));
+  const float size=1, height=1.03f, pitch=2, zpitch=2.1f;
+
+  // corners of the unit cube, and its faces as quads of corner indices
+  static const int quads[6][4]={
+    {0,2,3,1}, {4,5,7,6},   // bottom, top
+    {0,1,5,4}, {2,6,7,3},   // front, back
+    {0,4,6,2}, {1,3,7,5}    // left, right
+  };
+
+  faces.reserve(12L*k*k*k);
+  for(int x=0; x<k; x++)
+    for(int y=0; y<k; y++)
+      for(int z=0; z<k; z++){
+        Vertex origin={x*pitch,y*pitch,z*zpitch};
+        Vertex corners[8];
+        for(int c=0; c<8; c++)
+          corners[c]=origin+(Vertex){(c&1) ? size : 0,(c&2) ? size : 0,(c&4) ? height : 0};
+        Vertex center=origin+(Vertex){size/2,size/2,height/2};
+
+        for(int f=0; f<6; f++){
+          const Vertex& a=corners[quads[f][0]];
+          const Vertex& b=corners[quads[f][1]];
+          const Vertex& c=corners[quads[f][2]];
+          const Vertex& d=corners[quads[f][3]];
+          Vertex outward=(a+c)*0.5f-center;
+          add(faces,a,b,c,outward);
+          add(faces,a,c,d,outward);
+        }
+      }
+}
+
+// punch holes and duplicate faces, at fixed strides so the result is deterministic
+void MeshGenerator::breakManifold(std::vector<Face>& faces)
+{
+  std::vector<Face> result;
+  result.reserve(faces.size()+faces.size()/89+1);
+  for(unsigned int i=0; i<faces.size(); i++){
+    if(i%97==13) continue;          // a hole, its edges are used only once
+    result.push_back(faces[i]);
+    if(i%89==7)                     // an edge used by four faces
+      result.push_back(faces[i]);
+  }
+  faces.swap(result);
+}
+
+// add a triangle, flipped if it doesn't face along outward
+void MeshGenerator::add(std::vector<Face>& faces, const Vertex& a, const Vertex& b, const Vertex& c, const Vertex& outward)
+{
+  Vertex ab=b-a, ac=c-a;
+  Vertex n={ab.y*ac.z-ab.z*ac.y,ab.z*ac.x-ab.x*ac.z,ab.x*ac.y-ab.y*ac.x};
+  Face f={{a,b,c}};
+  if(n.dot(outward)<0)
+    std::swap(f[1],f[2]);
+  faces.push_back(f);
+}
@@ -0,0 +1,54 @@
+#ifndef __MESHGEN_H__
+#define __MESHGEN_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <array>
+
+#include "datastructures.h"
+
+// deterministic synthetic meshes for benchmarking
+// the same shape and size always give the same triangles, so timings of different
+// builds and machines are comparable.
+class MeshGenerator {
+  public:
+    typedef std::array<Vertex,3> Face;
+
+    // the known shapes: sphere, torus and lattice.
+    // a "-nm" suffix, e.g. sphere-nm, makes a non manifold variant with holes and duplicate faces.
+    static const char* shapes[];
+
+    // generate about the given number of triangles of a shape, ordered counter clockwise seen
+    // from outside. returns false for an unknown shape.
+    static bool generate(const std::string& shape, long triangles, std::vector<Face>& faces);
+
+    // write the faces as an ASCII .stl file. returns false if it can't be written.
+    static bool writeStl(const char* filename, const std::vector<Face>& faces);
+
+    // the .stl file of a shape and size in directory, generated if it doesn't exist yet.
+    // throws std::runtime_error for unknown shapes or if it can't be written.
+    static std::string cachedStl(const std::string& directory, const std::string& shape, long triangles);
+
+    // a gzip compressed copy of a file, as filename.gz, made if it doesn't exist yet.
+    // throws std::runtime_error if it can't be written.
+    static std::string cachedGzip(const std::string& filename);
+
+  private:
+    // UV sphere of radius r
+    static void sphere(long triangles, float r, std::vector<Face>& faces);
+
+    // torus of major radius R and minor radius r, lying in the xy plane
+    static void torus(long triangles, float R, float r, std::vector<Face>& faces);
+
+    // grid of separate cubes, giving many small loops per layer
+    static void lattice(long triangles, std::vector<Face>& faces);
+
+    // punch holes and duplicate faces
+    static void breakManifold(std::vector<Face>& faces);
+
+    // add a triangle, flipped if it doesn't face along outward
+    static void add(std::vector<Face>& faces, const Vertex& a, const Vertex& b, const Vertex& c, const Vertex& outward);
+};
+
+#endif //__MESHGEN_H__
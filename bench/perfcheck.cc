@@ -0,0 +1,269 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include "meshgen.h"
+#include "perfcheck.h"
+
+// the reference meshes: manifold and non manifold, smooth contours for arcs and many small loops
+static const struct { const char* shape; long triangles; } corpus[]={
+  {"sphere",     100000},
+  {"torus",      100000},
+  {"lattice",    100000},
+  {"sphere-nm",  100000},
+  {"lattice-nm",  10000},
+};
+
+PerfCheck::PerfCheck()
+{
+  this->katana="build/katana";
+  this->directory="build/bench";
+  this->config="config.ini";
+  this->timeTolerance=0.5;
+  this->warnOnTime=false;
+  this->memoryTolerance=0.15;
+  this->memorySlackKb=4096;
+  this->runs=5;
+}
+
+// the median of a few timings
+static double median(std::vector<double> seconds)
+{
+  std::sort(seconds.begin(),seconds.end());
+  size_t n=seconds.size();
+  return (n%2) ? seconds[n/2] : (seconds[n/2-1]+seconds[n/2])/2;
+}
+
+// hash of a file, to detect any change of the gcode
+static std::string fileHash(const std::string& filename)
+{
+  FILE* file=fopen(filename.c_str(),"rb");
+  if(!file)
+    throw std::runtime_error("Can't read "+filename);
+  unsigned long long hash=1469598103934665603ULL;
+  unsigned char buffer[65536];
+  size_t n;
+  while((n=fread(buffer,1,sizeof(buffer),file))>0)
+    for(size_t i=0; i<n; i++)
+      hash=(hash^buffer[i])*1099511628211ULL;
+  fclose(file);
+  char text[32];
+  snprintf(text,sizeof(text),"%016llx",hash);
+  return text;
+}
+
+// wall time of a fixed sorting and hashing workload, the unit of the relative times.
+// it stands for the memory and compute mix of slicing without depending on katana's code.
+double PerfCheck::calibrate()
+{
+  const int count=1<<20;
+  std::vector<float> values(count);
+  std::vector<double> seconds;
+  volatile unsigned int sum=0;  // keeps the work from being optimized away
+  for(int run=0; run<this->runs; run++){
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    for(int pass=0; pass<4; pass++){
+      unsigned int state=12345+pass;
+      for(int i=0; i<count; i++){
+        state=state*1664525+1013904223;
+        values[i]=(float)(state>>8);
+      }
+      std::sort(values.begin(),values.end());
+      sum+=(unsigned int)values[count/2];
+    }
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+  }
+  return median(seconds);
+}
+
+// read a number following "name": in the stats JSON written by katana
+static double jsonValue(const std::string& json, const char* name)
+{
+  std::string key=std::string("\"")+name+"\":";
+  size_t position=json.find(key);
+  if(position==std::string::npos)
+    throw std::runtime_error(std::string("Stats have no value ")+name);
+  return atof(json.c_str()+position+key.size());
+}
+
+// run katana once, returning its peak RSS
+long PerfCheck::runKatana(const std::string& input, const std::string& output, const std::string& stats)
+{
+  pid_t pid=fork();
+  if(pid<0)
+    throw std::runtime_error("Can't start "+this->katana);
+  if(pid==0){
+    // the progress messages are not of interest
+    int null=open("/dev/null",O_WRONLY);
+    if(null>=0) dup2(null,1);
+    execl(this->katana.c_str(),this->katana.c_str(),"--config",this->config.c_str(),"--stats",stats.c_str(),
+        input.c_str(),output.c_str(),(char*)NULL);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if(wait4(pid,&status,0,&usage)!=pid || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+    throw std::runtime_error(this->katana+" failed on "+input);
+  return usage.ru_maxrss;
+}
+
+// slice one mesh and measure it
+PerfCheck::Measurement PerfCheck::measure(const std::string& mesh)
+{
+  std::string input=this->directory+"/"+mesh+".stl";
+  std::string output=this->directory+"/"+mesh+".gcode";
+  std::string stats=this->directory+"/"+mesh+".json";
+
+  Measurement m;
+  m.mesh=mesh;
+  m.relative=0;
+  m.peakRssKb=0;
+  std::vector<double> seconds;
+  for(int run=0; run<this->runs; run++){
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    long rss=this->runKatana(input,output,stats);
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+    m.peakRssKb=std::max(m.peakRssKb,rss);
+  }
+  m.seconds=median(seconds);
+
+  FILE* file=fopen(stats.c_str(),"r");
+  if(!file)
+    throw std::runtime_error("Can't read "+stats);
+  std::string json;
+  char buffer[4096];
+  size_t n;
+  while((n=fread(buffer,1,sizeof(buffer),file))>0)
+    json.append(buffer,n);
+  fclose(file);
+
+  m.gcodeBytes=(long long)jsonValue(json,"gcode_bytes");
+  m.travels=(long long)jsonValue(json,"travels");
+  m.extrusions=(long long)jsonValue(json,"extrusions");
+  m.gcodeHash=fileHash(output);
+  return m;
+}
+
+bool PerfCheck::readBaseline(const char* filename, std::vector<Measurement>& baseline)
+{
+  FILE* file=fopen(filename,"r");
+  if(!file) return false;
+  char line[1024];
+  while(fgets(line,sizeof(line),file)){
+    if(line[0]=='#' || line[0]=='\n') continue;
+    char mesh[256], hash[64];
+    Measurement m;
+    if(sscanf(line,"%255s %lf %lf %ld %lld %lld %lld %63s",mesh,&m.seconds,&m.relative,&m.peakRssKb,&m.gcodeBytes,&m.travels,&m.extrusions,hash)!=8){
+      fclose(file);
+      throw std::runtime_error(std::string("Bad baseline line in ")+filename+": "+line);
+    }
+    m.mesh=mesh;
+    m.gcodeHash=hash;
+    baseline.push_back(m);
+  }
+  fclose(file);
+  return true;
+}
+
+void PerfCheck::writeBaseline(const char* filename, const std::vector<Measurement>& measurements, double calibration)
+{
+  FILE* file=fopen(filename,"w");
+  if(!file)
+    throw std::runtime_error(std::string("Can't write ")+filename);
+  fprintf(file,"# katana performance baseline, written by make perfbaseline\n");
+  fprintf(file,"# calibration %.4f s\n",calibration);
+  fprintf(file,"# mesh seconds relative_time peak_rss_kb gcode_bytes travels extrusions gcode_hash\n");
+  for(unsigned int i=0; i<measurements.size(); i++){
+    const Measurement& m=measurements[i];
+    fprintf(file,"%s %.4f %.3f %ld %lld %lld %lld %s\n",m.mesh.c_str(),m.seconds,m.relative,m.peakRssKb,m.gcodeBytes,m.travels,m.extrusions,m.gcodeHash.c_str());
+  }
+  if(fclose(file)!=0)
+    throw std::runtime_error(std::string("Can't write ")+filename);
+}
+
+// slice the corpus and compare with the baseline file
+int PerfCheck::run(const char* baselineFile, bool update)
+{
+  std::vector<Measurement> baseline;
+  if(!update && !this->readBaseline(baselineFile,baseline))
+    throw std::runtime_error(std::string("Can't read ")+baselineFile+", create it with make perfbaseline");
+  std::map<std::string,const Measurement*> byMesh;
+  for(unsigned int i=0; i<baseline.size(); i++)
+    byMesh[baseline[i].mesh]=&baseline[i];
+
+  double calibration=this->calibrate();
+  printf("Calibration %.3f s\n",calibration);
+
+  std::vector<Measurement> measurements;
+  int regressions=0;
+  printf("%-18s %10s %9s %10s %12s %10s %10s  %s\n","mesh","seconds","relative","rss kb","gcode bytes","travels","extrusions","result");
+  for(unsigned int i=0; i<sizeof(corpus)/sizeof(corpus[0]); i++){
+    MeshGenerator::cachedStl(this->directory,corpus[i].shape,corpus[i].triangles);
+    std::string mesh=std::string(corpus[i].shape)+"-"+std::to_string(corpus[i].triangles);
+    Measurement m=this->measure(mesh);
+    m.relative=m.seconds/calibration;
+    measurements.push_back(m);
+    printf("%-18s %10.3f %9.3f %10ld %12lld %10lld %10lld  ",m.mesh.c_str(),m.seconds,m.relative,m.peakRssKb,m.gcodeBytes,m.travels,m.extrusions);
+
+    if(update){
+      printf("recorded\n");
+      continue;
+    }
+    if(byMesh.count(mesh)==0){
+      printf("no baseline\n");
+      regressions++;
+      continue;
+    }
+
+    // compare with the baseline, listing every problem
+    const Measurement& b=*byMesh[mesh];
+    std::string problems;
+    char text[256];
+    bool slower=m.relative>b.relative*(1+this->timeTolerance);
+    if(slower && !this->warnOnTime){
+      snprintf(text,sizeof(text)," slower: %.3f relative time, baseline %.3f (+%.0f%%)",m.relative,b.relative,(m.relative/b.relative-1)*100);
+      problems+=text;
+    }
+    if(m.peakRssKb>b.peakRssKb*(1+this->memoryTolerance)+this->memorySlackKb){
+      snprintf(text,sizeof(text)," more memory: %ld kB, baseline %ld kB (+%.0f%%)",m.peakRssKb,b.peakRssKb,(m.peakRssKb/(double)b.peakRssKb-1)*100);
+      problems+=text;
+    }
+    if(m.gcodeHash!=b.gcodeHash){
+      snprintf(text,sizeof(text)," gcode changed: %lld bytes, %lld travels, %lld extrusions, baseline %lld, %lld, %lld",
+          m.gcodeBytes,m.travels,m.extrusions,b.gcodeBytes,b.travels,b.extrusions);
+      problems+=text;
+    }
+
+    if(problems.empty())
+      printf("ok (%+.0f%% relative time%s, %+.0f%% memory)\n",(m.relative/b.relative-1)*100,
+          slower ? ", slower" : "",(m.peakRssKb/(double)b.peakRssKb-1)*100);
+    else{
+      printf("FAILED:%s\n",problems.c_str());
+      regressions++;
+    }
+  }
+
+  if(update){
+    this->writeBaseline(baselineFile,measurements,calibration);
+    printf("Baseline written to %s\n",baselineFile);
+  }else if(regressions)
+    printf("%d of %u meshes regressed. If the changes are intended, record them with make perfbaseline\n",
+        regressions,(unsigned int)measurements.size());
+  else
+    printf("No regressions\n");
+  return regressions;
+}
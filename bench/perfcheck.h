@@ -0,0 +1,68 @@
+#ifndef __PERFCHECK_H__
+#define __PERFCHECK_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// end to end performance regression check
+// runs the katana binary on a corpus of generated meshes and compares wall time, peak memory,
+// output size, travel and extrusion counts and a hash of the gcode against stored baselines.
+// time and memory may grow within a tolerance, the gcode has to be unchanged. intended changes
+// are accepted by writing a new baseline.
+// wall times are the median of several runs divided by the median time of a fixed calibration
+// workload, so a baseline taken on another machine or under a different load stays comparable.
+class PerfCheck {
+  public:
+    // the result of slicing one mesh
+    struct Measurement {
+      std::string mesh;
+      double seconds;            // median wall time of the runs
+      double relative;           // seconds divided by the calibration time
+      long peakRssKb;            // peak resident set size of the process
+      long long gcodeBytes;
+      long long travels;
+      long long extrusions;
+      std::string gcodeHash;
+    };
+
+    PerfCheck();
+
+    // path of the katana binary, directory for meshes and gcode, and the config to slice with
+    std::string katana;
+    std::string directory;
+    std::string config;
+
+    // allowed growth of the relative time. it is generous, as timing is noisy even relative
+    // to the calibration. with warnOnTime a slower job is only reported, not counted.
+    double timeTolerance;
+    bool warnOnTime;
+
+    // allowed memory growth, as a fraction of the baseline plus an absolute slack
+    // that keeps small jobs from failing on noise
+    double memoryTolerance;
+    long memorySlackKb;
+
+    // runs per mesh and of the calibration, the median counts
+    int runs;
+
+    // slice the corpus and compare with the baseline file.
+    // returns the number of regressions, or writes the file instead if update is set.
+    // throws std::runtime_error if a run fails or the files can't be read or written.
+    int run(const char* baselineFile, bool update);
+
+  private:
+    // wall time of a fixed sorting and hashing workload, the unit of the relative times
+    double calibrate();
+
+    // slice one mesh and measure it
+    Measurement measure(const std::string& mesh);
+
+    // run katana once, returning its peak RSS
+    long runKatana(const std::string& input, const std::string& output, const std::string& stats);
+
+    bool readBaseline(const char* filename, std::vector<Measurement>& baseline);
+    void writeBaseline(const char* filename, const std::vector<Measurement>& measurements, double calibration);
+};
+
+#endif //__PERFCHECK_H__